@@ -4,11 +4,10 @@ const SVG = require("svg.js")(window);
 const document = window.document;
 const csv = require("csv-load-sync");
 const fs = require("fs");
-const os = require("os");
 const path = require("path");
-const util = require("util");
 const process = require("process");
-const exec = util.promisify(require("child_process").exec);
+const readline = require("readline");
+const { spawn } = require("child_process");
 const commandLineArgs = require("command-line-args");
 require("colors");
 
@@ -136,31 +135,40 @@ function hasChildren(boxes, node_id) {
   return false;
 }
 
-const optionDefinitions = [
-  { name: "input", type: String, defaultOption: true },
-  { name: "kerf", type: Boolean },
-  { name: "groupMultipleBoards", type: Boolean },
-  { name: "stockWaste", type: Number },
-  { name: "boardWaste", type: Number },
-  { name: "output", type: String },
-];
-
-(async function run() {
-  const options = commandLineArgs(optionDefinitions);
+// Solve all the jobs with a single packingsolver process in server mode. Jobs
+// are written as JSON lines on its standard input and the solutions are read
+// as JSON lines on its standard output. Resolves to a map from job id to the
+// final solution of the job.
+function solveBatch(packingsolverBinary, jobs) {
+  return new Promise((resolve, reject) => {
+    const solver = spawn(packingsolverBinary, ["--server"], {
+      stdio: ["pipe", "pipe", "inherit"],
+    });
+    const solutions = new Map();
+
+    readline.createInterface({ input: solver.stdout }).on("line", (line) => {
+      const event = JSON.parse(line);
+      if (event.event === "end") {
+        solutions.set(event.id, event);
+      } else if (event.event === "error") {
+        console.log(`Failed to solve ${event.id}: ${event.message}`.red);
+      }
+    });
+    solver.on("error", reject);
+    solver.on("close", () => resolve(solutions));
 
-  if (!options.input) {
-    console.log(
-      "You must provide a path to the input folder containing boards.csv and stock.csv e.g. cutlayout path/to/foo"
-        .red
-    );
-    return;
-  }
+    for (const job of jobs) {
+      solver.stdin.write(JSON.stringify(job) + "\n");
+    }
+    solver.stdin.end();
+  });
+}
 
+// Read an input folder and build the packingsolver job for it.
+function prepareLayout(input, options) {
   var config = {};
-  if (fs.existsSync(path.join(options.input, "config.json"))) {
-    config = JSON.parse(
-      fs.readFileSync(path.join(options.input, "config.json"))
-    );
+  if (fs.existsSync(path.join(input, "config.json"))) {
+    config = JSON.parse(fs.readFileSync(path.join(input, "config.json")));
   }
 
   const KERF = (config.kerf || options.kerf || 0.125) / 2;
@@ -171,8 +179,8 @@ const optionDefinitions = [
 
   // Spacing between boards, in inches
   const STOCK_SPACING = 3;
-  const boards = csv(path.join(options.input, "boards.csv"));
-  const stock = csv(path.join(options.input, "stock.csv"));
+  const boards = csv(path.join(input, "boards.csv"));
+  const stock = csv(path.join(input, "stock.csv"));
 
   // Parse stock inputs and add padding as needed.
   let currentX = 0;
@@ -206,54 +214,33 @@ const optionDefinitions = [
     }
   }
 
-  // Make a temporary directory to write intermediate files to
-  const tempPath = fs.mkdtempSync(`${os.tmpdir()}${path.sep}`);
-
-  // Write stock and items files in the format required for `packingsolver`
-  const stockData = [["ID", "WIDTH", "HEIGHT"]];
-  for (let i = 0; i < stock.length; ++i) {
-    stockData.push([
-      i,
-      Math.floor(stock[i].w * 1000),
-      Math.floor(stock[i].h * 1000),
-    ]);
-  }
-  fs.writeFileSync(path.join(tempPath, "TEST_bins.csv"), stockData.join("\n"));
-
-  const itemsData = [["ID", "WIDTH", "HEIGHT", "COPIES"]];
-  for (let i = 0; i < boards.length; ++i) {
-    itemsData.push(
-      [
-        boards[i].adjustedQuantity,
-        Math.floor(boards[i].w * 1000),
-        Math.floor(boards[i].h * 1000),
-        1,
-      ].join(",")
-    );
-  }
-  fs.writeFileSync(path.join(tempPath, "TEST_items.csv"), itemsData.join("\n"));
-
-  const packingsolverBinary = path.join(
-    __dirname,
-    "vendor/packingsolver/bazel-bin/packingsolver/main"
-  );
-  if (!fs.existsSync(packingsolverBinary)) {
-    console.log(
-      "You must build packingsolver with Bazel before running this program.".red
-    );
-    return;
-  }
+  // Describe stock and items in the format required by `packingsolver`
+  const job = {
+    id: input,
+    bins: stock.map((row) => ({
+      width: Math.floor(row.w * 1000),
+      height: Math.floor(row.h * 1000),
+    })),
+    items: boards.map((row) => ({
+      width: Math.floor(row.w * 1000),
+      height: Math.floor(row.h * 1000),
+      copies: 1,
+    })),
+    time_limit: 4,
+    branching_schemes: ["RG -p 3NHO", "RG -p 3NHO"],
+    algorithms: ["IMBA* -c 4", "IMBA* -c 5"],
+  };
+
+  return { stock, boards, GROUP_BOARDS, job };
+}
 
-  const {
-    stdout,
-    stderr,
-  } = await exec(
-    `${packingsolverBinary} -v -p RG -i ${tempPath}/TEST -c ${tempPath}/TEST_solution.csv -o ${tempPath}/TEST_output.json -t 4 -q "RG -p 3NHO" -a "IMBA* -c 4"  -q "RG -p 3NHO" -a "IMBA* -c 5"`,
-    { shell: true }
-  );
+// Draw the solution of a layout and return the SVG.
+function renderLayout(layout, solution) {
+  const { stock, boards, GROUP_BOARDS } = layout;
 
   // create svg.js instance
   const canvas = SVG(document.documentElement).size(inch(50), inch(200));
+  canvas.clear();
 
   // Draw each piece of stock
   for (const board of stock) {
@@ -294,16 +281,8 @@ const optionDefinitions = [
     centeredText(canvas, label, 30, board.x + w / 2, board.y + h + 1.5);
   }
 
-  const solution = csv(path.join(tempPath, "TEST_solution.csv"));
-  for (const box of solution) {
-    box.X = parseInt(box.X, 10);
-    box.Y = parseInt(box.Y, 10);
-    box.HEIGHT = parseInt(box.HEIGHT, 10);
-    box.WIDTH = parseInt(box.WIDTH, 10);
-  }
-
   // Render each cut and label each output board in the solution.
-  for (const box of solution) {
+  for (const box of solution.nodes) {
     // Map boards in the output to the original set of input boards to retrieve their name.
     const originalBoard = boards[box.TYPE];
 
@@ -316,7 +295,7 @@ const optionDefinitions = [
     // Boards are output as a tree - find the immediate parent of this node. If no parent,
     // treat the stock as the parent.
     var parent;
-    if (!box.PARENT) {
+    if (box.PARENT === null) {
       parent = {
         X: 0,
         Y: 0,
@@ -324,7 +303,7 @@ const optionDefinitions = [
         WIDTH: parentStock.w * 1000,
       };
     } else {
-      parent = solution[box.PARENT];
+      parent = solution.nodes[box.PARENT];
     }
 
     // Does this map to a board in our input file? If so, label it.
@@ -372,7 +351,7 @@ const optionDefinitions = [
       drawCuts(canvas, box, parent, parentStock.x, parentStock.y);
 
       // If this node has no children and no label, it is waste. Mark it as such.
-      if (!hasChildren(solution, box.NODE_ID)) {
+      if (!hasChildren(solution.nodes, box.NODE_ID)) {
         drawWaste(canvas, x, y, box.HEIGHT / 1000, box.WIDTH / 1000);
       }
     }
@@ -385,10 +364,64 @@ const optionDefinitions = [
     }
   }
 
-  if (options.output) {
-    const outputPath = path.resolve(__dirname, options.output);
-    fs.writeFileSync(outputPath, canvas.svg());
-  } else {
-    console.log(canvas.svg());
+  return canvas.svg();
+}
+
+const optionDefinitions = [
+  { name: "input", type: String, multiple: true, defaultOption: true },
+  { name: "kerf", type: Boolean },
+  { name: "groupMultipleBoards", type: Boolean },
+  { name: "stockWaste", type: Number },
+  { name: "boardWaste", type: Number },
+  { name: "output", type: String },
+];
+
+(async function run() {
+  const options = commandLineArgs(optionDefinitions);
+
+  if (!options.input || options.input.length === 0) {
+    console.log(
+      "You must provide a path to the input folder containing boards.csv and stock.csv e.g. cutlayout path/to/foo"
+        .red
+    );
+    return;
+  }
+
+  const packingsolverBinary = path.join(
+    __dirname,
+    "vendor/packingsolver/bazel-bin/packingsolver/main"
+  );
+  if (!fs.existsSync(packingsolverBinary)) {
+    console.log(
+      "You must build packingsolver with Bazel before running this program.".red
+    );
+    return;
+  }
+
+  // All the layouts of the batch are solved by the same process.
+  const layouts = options.input.map((input) => prepareLayout(input, options));
+  const solutions = await solveBatch(
+    packingsolverBinary,
+    layouts.map((layout) => layout.job)
+  );
+
+  for (const layout of layouts) {
+    const solution = solutions.get(layout.job.id);
+    if (!solution) {
+      continue;
+    }
+    const svg = renderLayout(layout, solution);
+
+    if (options.output && options.input.length === 1) {
+      fs.writeFileSync(path.resolve(__dirname, options.output), svg);
+    } else if (options.output) {
+      // With several inputs, the output is a directory.
+      const outputPath = path.resolve(__dirname, options.output);
+      fs.mkdirSync(outputPath, { recursive: true });
+      const name = path.basename(path.resolve(layout.job.id)) + ".svg";
+      fs.writeFileSync(path.join(outputPath, name), svg);
+    } else {
+      console.log(svg);
+    }
   }
 })();